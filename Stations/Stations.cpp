@@ -15,7 +15,14 @@
 #include <fstream>
 #include <sstream>
 #include <atomic>
+#include <chrono>
+#include <string>
+#include <cstring>
+#include <cstdlib>
+#include <system_error>
+#include "../taskbased/taskbased/cofarm.h" // Coroutine tasks, for running the trains without a thread each
 #include <windows.h>
+#include <psapi.h>
 
 
 // Function to hide the console cursor for cleaner simulation display
@@ -40,16 +47,22 @@ public:
     RailwaySystem(); // Constructor
     ~RailwaySystem(); // Destructor
     void startSimulation(); // Function to start the railway simulation
+    void startCoroutineSimulation(); // Same simulation, with the trains and display as coroutines on a CoFarm
 
 private:
     struct Segment { // Segment structure representing a piece of track
         std::mutex mutex; // Mutex for synchronization
         std::condition_variable cond; // Condition variable for segment occupancy
         bool occupied = false; // Flag indicating if the segment is occupied
+        CoSemaphore available{ 1, 1 }; // Held by the coroutine train occupying the segment (releasing it twice throws)
     };
 
     void trainA(); // Function to simulate train A's movement
     void trainB(); // Function to simulate train B's movement
+    CoTask<> trainACoroutine(); // Train A's movement, suspending instead of blocking a thread
+    CoTask<> trainBCoroutine(); // Train B's movement, suspending instead of blocking a thread
+    CoTask<> displayCoroutine(); // Redraws the tracks every 500ms while the simulation is active
+    void occupySegment(int index, bool occupied); // Update a segment's flag under its mutex (for the display)
 
     void displayTracks(); // Function to display the current state of the tracks
     void logEvent(const std::string& event); // Function to log events to a file
@@ -69,7 +82,8 @@ private:
 };
 
 // Constructor initializes the simulation
-RailwaySystem::RailwaySystem() : positionA(1), positionB(totalLength - 1), simulationActive(true) {
+RailwaySystem::RailwaySystem() : positionA(1), simulationActive(true) {
+    positionB = totalLength - 1; // Not in the initializer list: totalLength is declared after positionB, so it isn't set yet there
     logFile.open("RailwaySystemLog.txt", std::ofstream::out | std::ofstream::app); // Open log file
     int colors[] = { 31, 33, 32, 34, 36 }; // ANSI color codes for visualization
 
@@ -195,6 +209,97 @@ void RailwaySystem::trainB() {
 
 
 
+// startCoroutineSimulation runs the same trains as startSimulation, but as coroutines
+// multiplexed onto the CoFarm's worker threads rather than one thread each
+void RailwaySystem::startCoroutineSimulation() {
+    CoFarm farm;
+    farm.spawn(displayCoroutine());
+    farm.spawn(trainACoroutine());
+    farm.spawn(trainBCoroutine());
+
+    // Only returns once every coroutine has finished (the trains never do, as in startSimulation)
+    farm.run();
+}
+
+CoTask<> RailwaySystem::displayCoroutine() {
+    while (simulationActive) {
+        displayTracks();
+        co_await sleep_for(std::chrono::milliseconds(500));
+    }
+}
+
+void RailwaySystem::occupySegment(int index, bool occupied) {
+    std::lock_guard<std::mutex> lock(segments[index]->mutex);
+    segments[index]->occupied = occupied;
+}
+
+CoTask<> RailwaySystem::trainACoroutine() {
+    // Same route as trainA; waiting for a segment suspends this coroutine and frees its worker thread
+    while (true) {
+        int segmentIndex = positionA / (segmentLength + shortStationLength);
+        bool isStation = (positionA % (segmentLength + shortStationLength)) == 1;
+
+        // At the start of a station, wait for the segment to be free and then occupy it
+        if (isStation) {
+            co_await segments[segmentIndex]->available.acquire();
+            occupySegment(segmentIndex, true);
+        }
+
+        // Move the train forward by one unit
+        positionA = (positionA + 1) % totalLength;
+        co_await sleep_for(std::chrono::seconds(1)); // Simulate time taken to move
+
+        // At the end of a segment, free the previous one and wake the train waiting for it
+        bool isSegmentEnd = (positionA % (segmentLength + shortStationLength)) == 0;
+        segmentIndex = positionA / (segmentLength + shortStationLength);
+        int prevIndex = segmentIndex - 1;
+        if (prevIndex < 0) prevIndex = static_cast<int>(segments.size()) - 1;
+        if (isSegmentEnd) {
+            occupySegment(prevIndex, false);
+            segments[prevIndex]->available.release();
+        }
+
+        logEvent("Train A has finished one iteration of its journey.");
+    }
+}
+
+CoTask<> RailwaySystem::trainBCoroutine() {
+    // Same route as trainB; waiting for a segment suspends this coroutine and frees its worker thread
+
+    // Train B starts inside its last segment, which it releases on the way out, so it must hold it first
+    int startIndex = positionB / (segmentLength + shortStationLength);
+    co_await segments[startIndex]->available.acquire();
+    occupySegment(startIndex, true);
+
+    while (true) {
+        int segmentIndex = positionB / (segmentLength + shortStationLength);
+        bool isStation = (positionB % (segmentLength + shortStationLength)) == 0;
+
+        // At a station, wait for the previous segment to be free and then occupy it
+        if (isStation) {
+            int prevIndex = segmentIndex - 1;
+            if (prevIndex < 0) prevIndex = static_cast<int>(segments.size()) - 1;
+            co_await segments[prevIndex]->available.acquire();
+            occupySegment(prevIndex, true);
+        }
+
+        // Move the train backward by one unit, handling wrap-around at the start of the track
+        positionB = (positionB - 1) % totalLength;
+        if (positionB < 0) positionB = totalLength - 1;
+        co_await sleep_for(std::chrono::seconds(1)); // Simulate time taken to move
+
+        // At the end of a segment, free the current one and wake the train waiting for it
+        bool isSegmentEnd = ((positionB) % (segmentLength + shortStationLength)) == 1;
+        if (isSegmentEnd) {
+            occupySegment(segmentIndex, false);
+            segments[segmentIndex]->available.release();
+        }
+
+        logEvent("Train B has finished its journey.");
+    }
+}
+
+
 void RailwaySystem::displayTracks() {
     std::lock_guard<std::mutex> lock(displayMutex);
     std::cout << "\x1B[2J\x1B[H"; // Clears the screen
@@ -257,10 +362,212 @@ void RailwaySystem::logEvent(const std::string& event) {
     }
 }
 
-int main() {
+// Benchmark: thousands of trains as coroutines, compared with a thread per train
+
+// Private memory committed by this process, in bytes
+size_t privateBytes() {
+    PROCESS_MEMORY_COUNTERS_EX counters = {};
+    GetProcessMemoryInfo(GetCurrentProcess(), reinterpret_cast<PROCESS_MEMORY_COUNTERS*>(&counters), sizeof(counters));
+    return counters.PrivateUsage;
+}
+
+// Growth in private memory between two samples, per activity (0 if it shrank)
+size_t bytesPerActivity(size_t before, size_t after, int count) {
+    return (after > before) ? (after - before) / count : 0;
+}
+
+// A train going round a circular track, holding one segment at a time.
+// The track has more segments than trains, so they can't all block each other.
+CoTask<> benchmarkTrain(std::vector<std::unique_ptr<CoSemaphore>>& track, int start, int moves) {
+    int segment = start;
+    co_await track[segment]->acquire();
+    for (int i = 0; i < moves; ++i) {
+        int next = (segment + 1) % static_cast<int>(track.size());
+        co_await track[next]->acquire(); // Wait for the next segment to be free
+        track[segment]->release(); // Then leave the current one
+        segment = next;
+        co_await sleep_for(std::chrono::milliseconds(1)); // Simulate time taken to move
+    }
+    track[segment]->release();
+}
+
+// Two coroutines taking turns; each turn is one switch between activities.
+// They time themselves, so the farm's worker thread startup isn't counted:
+// start is set by whichever runs first, end by whichever finishes last.
+CoTask<> pingPong(CoSemaphore& mine, CoSemaphore& theirs, int rounds, co_clock::time_point& start, co_clock::time_point& end) {
+    if (start == co_clock::time_point()) start = co_clock::now();
+    for (int i = 0; i < rounds; ++i) {
+        co_await mine.acquire();
+        theirs.release();
+    }
+    end = co_clock::now();
+}
+
+void runBenchmark(int numTrains) {
+    typedef std::chrono::steady_clock the_clock;
+    const int moves = 100;
+    const int rounds = 100000;
+
+    // Coroutine trains: memory per activity and time to run them all
+    {
+        std::vector<std::unique_ptr<CoSemaphore>> track;
+        for (int i = 0; i < 2 * numTrains; ++i) {
+            track.push_back(std::make_unique<CoSemaphore>(1));
+        }
+
+        CoFarm farm;
+        size_t memBefore = privateBytes();
+        size_t framesBefore = CoFrameStats::live_bytes;
+        size_t liveFramesBefore = CoFrameStats::live_frames;
+        CoFrameStats::peak_bytes = framesBefore; // Measure the peak during this run only
+        for (int i = 0; i < numTrains; ++i) {
+            farm.spawn(benchmarkTrain(track, 2 * i, moves));
+        }
+        size_t frameBytes = CoFrameStats::live_bytes - framesBefore;
+        size_t memAfter = privateBytes();
+
+        auto start = the_clock::now();
+        farm.run();
+        auto end = the_clock::now();
+        auto time_taken = std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count();
+
+        std::cout << numTrains << " coroutine trains on " << farm.num_threads() << " threads:\n";
+        std::cout << "  coroutine frame: " << frameBytes / numTrains << " bytes per train\n";
+        std::cout << "  peak frames:     " << (CoFrameStats::peak_bytes - framesBefore) / numTrains << " bytes per train\n";
+        std::cout << "  frames leaked:   " << CoFrameStats::live_frames - liveFramesBefore << "\n";
+        std::cout << "  private memory:  " << bytesPerActivity(memBefore, memAfter, numTrains) << " bytes per train\n";
+        std::cout << "  " << numTrains * moves << " moves took " << time_taken << " ms\n";
+    }
+
+    // Thread trains: memory per activity, with every thread parked on a condition variable.
+    // Each thread reserves a whole stack, so the OS may run out before numTrains of them
+    // (especially in a 32-bit process); then measure the ones that were created.
+    {
+        std::mutex mutex;
+        std::condition_variable cond;
+        bool released = false;
+        std::atomic<int> started(0);
+        std::vector<std::thread> threads;
+
+        size_t memBefore = privateBytes();
+        try {
+            for (int i = 0; i < numTrains; ++i) {
+                threads.emplace_back([&]() {
+                    std::unique_lock<std::mutex> lock(mutex);
+                    started++;
+                    cond.wait(lock, [&] { return released; });
+                    });
+            }
+        }
+        catch (const std::system_error& e) {
+            std::cout << "Only " << threads.size() << " of " << numTrains << " threads could be created (" << e.what() << ")\n";
+        }
+        const int numThreads = static_cast<int>(threads.size());
+        while (started < numThreads) {
+            std::this_thread::yield();
+        }
+        size_t memAfter = privateBytes();
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            released = true;
+        }
+        cond.notify_all();
+        for (auto& thread : threads) {
+            thread.join();
+        }
+
+        if (numThreads > 0) {
+            std::cout << numThreads << " thread trains:\n";
+            std::cout << "  private memory:  " << bytesPerActivity(memBefore, memAfter, numThreads) << " bytes per train\n";
+        }
+    }
+
+    // Context switch cost: two coroutines on one worker thread taking turns
+    // (both run on that one thread, so start and end need no locking)
+    {
+        CoFarm farm(1);
+        CoSemaphore ping(1), pong(0);
+        co_clock::time_point start, end;
+        farm.spawn(pingPong(ping, pong, rounds, start, end));
+        farm.spawn(pingPong(pong, ping, rounds, start, end));
+        farm.run();
+        auto time_taken = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+        std::cout << "Coroutine switch: " << time_taken / (2 * rounds) << " ns\n";
+    }
+
+    // Context switch cost: two threads taking turns through a condition variable.
+    // Neither thread gets a turn until both are running, so thread startup isn't timed.
+    {
+        std::mutex mutex;
+        std::condition_variable cond;
+        int turn = -1;
+        std::atomic<int> started(0);
+        auto player = [&](int me) {
+            started++;
+            for (int i = 0; i < rounds; ++i) {
+                std::unique_lock<std::mutex> lock(mutex);
+                cond.wait(lock, [&] { return turn == me; });
+                turn = 1 - me;
+                cond.notify_one();
+            }
+        };
+
+        std::thread threadA(player, 0);
+        std::thread threadB(player, 1);
+        while (started < 2) {
+            std::this_thread::yield();
+        }
+
+        auto start = the_clock::now();
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            turn = 0;
+        }
+        cond.notify_all();
+        threadA.join();
+        threadB.join();
+        auto end = the_clock::now();
+        auto time_taken = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+        std::cout << "Thread switch:    " << time_taken / (2 * rounds) << " ns\n";
+    }
+}
+
+void printUsage() {
+    std::cerr << "Usage: Stations             - trains on their own threads\n";
+    std::cerr << "       Stations coroutines  - trains as coroutines on a CoFarm\n";
+    std::cerr << "       Stations bench [N]   - compare N coroutine trains with N thread trains (1 to 100000, default 5000)\n";
+}
+
+int main(int argc, char* argv[]) {
+    if (argc > 1 && strcmp(argv[1], "bench") == 0) {
+        int numTrains = 5000;
+        if (argc > 2) {
+            // Reject anything that isn't a whole number of trains in range
+            char* end = nullptr;
+            long n = strtol(argv[2], &end, 10);
+            if (end == argv[2] || *end != '\0' || n < 1 || n > 100000 || argc > 3) {
+                printUsage();
+                return 1;
+            }
+            numTrains = static_cast<int>(n);
+        }
+        runBenchmark(numTrains);
+        return 0;
+    }
+    if (argc > 2 || (argc == 2 && strcmp(argv[1], "coroutines") != 0)) {
+        printUsage();
+        return 1;
+    }
+
     hideCursor();
     RailwaySystem railwaySystem;
-    railwaySystem.startSimulation();
+    if (argc > 1 && strcmp(argv[1], "coroutines") == 0) {
+        railwaySystem.startCoroutineSimulation();
+    }
+    else {
+        railwaySystem.startSimulation();
+    }
 
     return 0;
 }
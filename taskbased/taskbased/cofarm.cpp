@@ -0,0 +1,125 @@
+#include "cofarm.h"
+
+CoFarm::CoFarm(int numThreads)
+    : numThreads(numThreads > 0 ? numThreads : std::thread::hardware_concurrency()) {
+    if (this->numThreads <= 0) this->numThreads = 1; // hardware_concurrency() may not know
+}
+
+// Deletes unfinished tasks. Only the root frames are destroyed: handles in the queues
+// may belong to child tasks, which are owned (and deleted) by their parent's frame
+CoFarm::~CoFarm() {
+    for (void *frame : liveTasks) {
+        std::coroutine_handle<>::from_address(frame).destroy();
+    }
+}
+
+// Adds a root task to the farm's ready queue; the farm takes ownership of its frame
+void CoFarm::spawn(CoTask<void> task) {
+    auto handle = task.release();
+    handle.promise().farm_ = this;
+    handle.promise().root_ = true;
+
+    std::lock_guard<std::mutex> guard(queueMutex);
+    liveTasks.insert(handle.address());
+    readyQueue.push_back(handle);
+    queueCond.notify_one();
+}
+
+// Runs the spawned tasks on the worker threads until they have all finished
+void CoFarm::run() {
+    for (int i = 0; i < numThreads; i++) {
+        workers.emplace_back(&CoFarm::worker, this);
+    }
+
+    // Wait for all worker threads to complete
+    for (auto& worker : workers) {
+        worker.join();
+    }
+    workers.clear(); // Clear the vector of threads
+
+    std::exception_ptr error;
+    std::swap(error, firstError);
+    if (error) std::rethrow_exception(error);
+}
+
+// Each worker resumes ready coroutines, wakes sleeping ones when their time comes,
+// and waits when there's nothing to do
+void CoFarm::worker() {
+    std::unique_lock<std::mutex> lock(queueMutex);
+    while (true) {
+        // Move any timers that have expired onto the ready queue,
+        // waking another worker for each one beyond the first so this one doesn't run them all
+        auto now = co_clock::now();
+        int expired = 0;
+        while (!timers.empty() && timers.top().when <= now) {
+            readyQueue.push_back(timers.top().handle);
+            timers.pop();
+            if (expired++ > 0) queueCond.notify_one();
+        }
+
+        if (firstError) {
+            break; // Exit if a task has failed
+        }
+        else if (!readyQueue.empty()) {
+            auto handle = readyQueue.front(); // Get the next coroutine
+            readyQueue.pop_front(); // Remove it from the queue
+            lock.unlock();
+            handle.resume(); // Run it until it next suspends
+            lock.lock();
+        }
+        else if (liveTasks.empty()) {
+            break; // Exit if every task has finished
+        }
+        else if (!timers.empty()) {
+            auto next = timers.top().when; // Copy it: the heap may change while we wait
+            queueCond.wait_until(lock, next);
+        }
+        else {
+            queueCond.wait(lock);
+        }
+    }
+}
+
+// Makes a suspended coroutine ready to run again
+void CoFarm::schedule(std::coroutine_handle<> handle) {
+    std::lock_guard<std::mutex> guard(queueMutex);
+    readyQueue.push_back(handle);
+    queueCond.notify_one();
+}
+
+// Makes a suspended coroutine ready to run again at the given time
+void CoFarm::schedule_at(co_clock::time_point when, std::coroutine_handle<> handle) {
+    std::lock_guard<std::mutex> guard(queueMutex);
+    bool earliest = timers.empty() || when < timers.top().when;
+    timers.push(Timer{ when, timerCount++, handle });
+    if (earliest) {
+        // Every idle worker is waiting for the old earliest timer (or for nothing),
+        // so wake them all to wait_until the new one
+        queueCond.notify_all();
+    }
+}
+
+// Called when a root task reaches its final suspend point
+void CoFarm::root_finished(std::coroutine_handle<> handle, std::exception_ptr error) {
+    void *frame = handle.address();
+    handle.destroy(); // Delete the task's frame
+
+    std::lock_guard<std::mutex> guard(queueMutex);
+    if (error && !firstError) firstError = error;
+    liveTasks.erase(frame);
+    if (liveTasks.empty() || firstError) {
+        queueCond.notify_all(); // Let all the workers exit
+    }
+}
+
+void co_schedule(CoFarm *farm, std::coroutine_handle<> handle) {
+    farm->schedule(handle);
+}
+
+void co_schedule_at(CoFarm *farm, co_clock::time_point when, std::coroutine_handle<> handle) {
+    farm->schedule_at(when, handle);
+}
+
+void co_root_finished(CoFarm *farm, std::coroutine_handle<> handle, std::exception_ptr error) {
+    farm->root_finished(handle, error);
+}
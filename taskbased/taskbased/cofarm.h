@@ -0,0 +1,84 @@
+#ifndef COFARM_H
+#define COFARM_H
+
+#include "cotask.h"
+
+#include <condition_variable>
+#include <coroutine>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+
+/** A pool of worker threads that runs CoTask coroutines.
+    Like Farm, but a coroutine that co_awaits a timer, another task, a CoEvent
+	or a CoSemaphore is parked rather than blocking its worker, so thousands of
+	logical activities can be multiplexed onto a handful of threads. */
+class CoFarm {
+public:
+	/** Create a farm with the given number of workers
+	    (0 means one per hardware thread). */
+	explicit CoFarm(int numThreads = 0);
+
+	/** Delete the frames of any tasks that haven't finished
+	    (never run, or left over after run() rethrew an exception).
+		Any CoEvent or CoSemaphore they were waiting on must not be
+		signalled afterwards. */
+	~CoFarm();
+
+	CoFarm(const CoFarm&) = delete;
+	CoFarm& operator=(const CoFarm&) = delete;
+
+	/** Add a task to the farm. It can be called before run(), or from inside
+	    a running coroutine to start another activity.
+		The task's frame will be deleted once it has finished. */
+	void spawn(CoTask<void> task);
+
+	/** Run the tasks in the farm.
+	    This method only returns once all the spawned tasks have completed,
+		or as soon as one of them throws an exception, which is rethrown here
+		(the other tasks are left unfinished, and are deleted with the farm).
+		It can be called again after spawning more tasks. */
+	void run();
+
+	int num_threads() const { return numThreads; }
+
+private:
+	friend void co_schedule(CoFarm *farm, std::coroutine_handle<> handle);
+	friend void co_schedule_at(CoFarm *farm, co_clock::time_point when, std::coroutine_handle<> handle);
+	friend void co_root_finished(CoFarm *farm, std::coroutine_handle<> handle, std::exception_ptr error);
+
+	/** A coroutine sleeping until a point in time. */
+	struct Timer {
+		co_clock::time_point when;
+		unsigned long long order; // Keeps timers with the same deadline in FIFO order
+		std::coroutine_handle<> handle;
+
+		bool operator>(const Timer& other) const
+		{
+			if (when != other.when) return when > other.when;
+			return order > other.order;
+		}
+	};
+
+	void worker();
+	void schedule(std::coroutine_handle<> handle);
+	void schedule_at(co_clock::time_point when, std::coroutine_handle<> handle);
+	void root_finished(std::coroutine_handle<> handle, std::exception_ptr error);
+
+	int numThreads;
+	std::mutex queueMutex;                          // Protects everything below
+	std::condition_variable queueCond;              // Signalled when there's work (or nothing left)
+	std::deque<std::coroutine_handle<>> readyQueue; // Coroutines ready to be resumed
+	std::priority_queue<Timer, std::vector<Timer>, std::greater<Timer>> timers; // Sleeping coroutines, earliest first
+	unsigned long long timerCount = 0;
+	std::unordered_set<void *> liveTasks;           // Frames of spawned tasks that haven't finished yet
+	std::exception_ptr firstError;                  // Set when a task throws; makes the workers stop
+	std::vector<std::thread> workers;
+};
+
+#endif
@@ -0,0 +1,378 @@
+#ifndef COTASK_H
+#define COTASK_H
+
+#include <atomic>
+#include <chrono>
+#include <climits>
+#include <coroutine>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <new>
+#include <optional>
+#include <stdexcept>
+#include <utility>
+
+class CoFarm;
+
+/** Clock used for CoFarm timers. */
+typedef std::chrono::steady_clock co_clock;
+
+// Hooks into the CoFarm that owns a coroutine (implemented in cofarm.cpp).
+// They take a plain CoFarm pointer so the awaitables below don't need the
+// full CoFarm definition.
+void co_schedule(CoFarm *farm, std::coroutine_handle<> handle);
+void co_schedule_at(CoFarm *farm, co_clock::time_point when, std::coroutine_handle<> handle);
+void co_root_finished(CoFarm *farm, std::coroutine_handle<> handle, std::exception_ptr error);
+
+/** Counters for the memory used by coroutine frames.
+    Every CoTask frame is allocated through CoPromiseBase, so these give the
+	exact cost of a suspended activity (compare with a thread's stack). */
+struct CoFrameStats {
+	static inline std::atomic<std::size_t> live_frames{ 0 };
+	static inline std::atomic<std::size_t> live_bytes{ 0 };
+	static inline std::atomic<std::size_t> peak_bytes{ 0 };
+};
+
+/** State shared by the promises of all CoTask types. */
+class CoPromiseBase {
+public:
+	static void *operator new(std::size_t size)
+	{
+		void *frame = ::operator new(size);
+		CoFrameStats::live_frames++;
+		std::size_t bytes = CoFrameStats::live_bytes += size;
+		std::size_t peak = CoFrameStats::peak_bytes.load();
+		while (bytes > peak && !CoFrameStats::peak_bytes.compare_exchange_weak(peak, bytes)) {
+		}
+		return frame;
+	}
+
+	static void operator delete(void *frame, std::size_t size)
+	{
+		CoFrameStats::live_frames--;
+		CoFrameStats::live_bytes -= size;
+		::operator delete(frame);
+	}
+
+	/** Tasks don't start until they are awaited or spawned on a CoFarm. */
+	std::suspend_always initial_suspend() noexcept { return {}; }
+
+	/** When the task finishes, resume whoever awaited it;
+	    a root task spawned on the farm reports back to the farm instead. */
+	struct FinalAwaiter {
+		bool await_ready() noexcept { return false; }
+
+		template <typename Promise>
+		std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> handle) noexcept
+		{
+			CoPromiseBase& promise = handle.promise();
+			if (promise.continuation_) {
+				return promise.continuation_;
+			}
+			if (promise.root_) {
+				// This destroys the frame, so don't touch the promise afterwards.
+				co_root_finished(promise.farm_, handle, promise.error_);
+			}
+			return std::noop_coroutine();
+		}
+
+		void await_resume() noexcept {}
+	};
+
+	FinalAwaiter final_suspend() noexcept { return {}; }
+
+	void unhandled_exception() { error_ = std::current_exception(); }
+
+	/** The farm whose workers run this coroutine. */
+	CoFarm *farm_ = nullptr;
+	/** The coroutine awaiting this one, if any. */
+	std::coroutine_handle<> continuation_;
+	/** True if this task was spawned directly on the farm. */
+	bool root_ = false;
+	/** Exception thrown out of the coroutine body, if any. */
+	std::exception_ptr error_;
+};
+
+template <typename T> class CoTask;
+
+template <typename T>
+class CoPromise : public CoPromiseBase {
+public:
+	CoTask<T> get_return_object();
+
+	template <typename U>
+	void return_value(U&& value) { value_.emplace(std::forward<U>(value)); }
+
+	T result()
+	{
+		if (error_) std::rethrow_exception(error_);
+		return std::move(*value_);
+	}
+
+private:
+	std::optional<T> value_;
+};
+
+template <>
+class CoPromise<void> : public CoPromiseBase {
+public:
+	CoTask<void> get_return_object();
+
+	void return_void() {}
+
+	void result()
+	{
+		if (error_) std::rethrow_exception(error_);
+	}
+};
+
+/** A coroutine task that runs on a CoFarm's worker threads.
+    Unlike a Task, it gives its thread back to the farm whenever it
+	co_awaits something that isn't ready (a timer, another CoTask,
+	a CoEvent or a CoSemaphore), so many of them can share a few threads.
+	Awaiting a CoTask<T> from another coroutine runs it and yields its result. */
+template <typename T = void>
+class [[nodiscard]] CoTask {
+public:
+	typedef CoPromise<T> promise_type;
+	typedef std::coroutine_handle<promise_type> handle_type;
+
+	explicit CoTask(handle_type handle)
+		: handle_(handle)
+	{
+	}
+
+	CoTask(CoTask&& other) noexcept
+		: handle_(std::exchange(other.handle_, nullptr))
+	{
+	}
+
+	CoTask(const CoTask&) = delete;
+	CoTask& operator=(const CoTask&) = delete;
+
+	~CoTask()
+	{
+		if (handle_) handle_.destroy();
+	}
+
+	struct Awaiter {
+		handle_type child;
+
+		bool await_ready() noexcept { return false; }
+
+		template <typename Promise>
+		std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> parent) noexcept
+		{
+			// The child runs on the same farm, straight away on this thread.
+			child.promise().farm_ = parent.promise().farm_;
+			child.promise().continuation_ = parent;
+			return child;
+		}
+
+		T await_resume() { return child.promise().result(); }
+	};
+
+	Awaiter operator co_await() && noexcept { return Awaiter{ handle_ }; }
+
+	/** Give up ownership of the coroutine (used by CoFarm::spawn). */
+	handle_type release() { return std::exchange(handle_, nullptr); }
+
+private:
+	handle_type handle_;
+};
+
+template <typename T>
+CoTask<T> CoPromise<T>::get_return_object()
+{
+	return CoTask<T>(std::coroutine_handle<CoPromise<T>>::from_promise(*this));
+}
+
+inline CoTask<void> CoPromise<void>::get_return_object()
+{
+	return CoTask<void>(std::coroutine_handle<CoPromise<void>>::from_promise(*this));
+}
+
+/** Awaitable that suspends the current coroutine until a point in time,
+    without blocking its worker thread. */
+class CoSleep {
+public:
+	explicit CoSleep(co_clock::time_point when)
+		: when_(when)
+	{
+	}
+
+	bool await_ready() const { return co_clock::now() >= when_; }
+
+	template <typename Promise>
+	void await_suspend(std::coroutine_handle<Promise> handle)
+	{
+		co_schedule_at(handle.promise().farm_, when_, handle);
+	}
+
+	void await_resume() {}
+
+private:
+	co_clock::time_point when_;
+};
+
+/** co_await sleep_for(d) is the coroutine version of std::this_thread::sleep_for(d). */
+template <typename Rep, typename Period>
+CoSleep sleep_for(std::chrono::duration<Rep, Period> duration)
+{
+	return CoSleep(co_clock::now() + std::chrono::duration_cast<co_clock::duration>(duration));
+}
+
+/** co_await yield() puts the current coroutine at the back of the farm's
+    queue, letting the other coroutines on the farm run. */
+class CoYield {
+public:
+	bool await_ready() const { return false; }
+
+	template <typename Promise>
+	void await_suspend(std::coroutine_handle<Promise> handle)
+	{
+		co_schedule(handle.promise().farm_, handle);
+	}
+
+	void await_resume() {}
+};
+
+inline CoYield yield()
+{
+	return CoYield();
+}
+
+/** A coroutine waiting on a CoEvent or CoSemaphore. */
+struct CoWaiter {
+	CoFarm *farm;
+	std::coroutine_handle<> handle;
+};
+
+/** A manual-reset event that coroutines can wait for.
+    Waiters are put back on the farm's queue when the event is set. */
+class CoEvent {
+public:
+	struct Awaiter {
+		CoEvent& event;
+
+		bool await_ready() { return event.is_set(); }
+
+		template <typename Promise>
+		bool await_suspend(std::coroutine_handle<Promise> handle)
+		{
+			std::lock_guard<std::mutex> guard(event.mutex_);
+			if (event.set_) {
+				return false; // Set while we were getting here: don't suspend
+			}
+			event.waiters_.push_back(CoWaiter{ handle.promise().farm_, handle });
+			return true;
+		}
+
+		void await_resume() {}
+	};
+
+	/** co_await event.wait() suspends until the event is set. */
+	Awaiter wait() { return Awaiter{ *this }; }
+
+	void set()
+	{
+		std::deque<CoWaiter> waiters;
+		{
+			std::lock_guard<std::mutex> guard(mutex_);
+			set_ = true;
+			waiters.swap(waiters_);
+		}
+		for (auto& waiter : waiters) {
+			co_schedule(waiter.farm, waiter.handle);
+		}
+	}
+
+	void reset()
+	{
+		std::lock_guard<std::mutex> guard(mutex_);
+		set_ = false;
+	}
+
+	bool is_set()
+	{
+		std::lock_guard<std::mutex> guard(mutex_);
+		return set_;
+	}
+
+private:
+	std::mutex mutex_;
+	bool set_ = false;
+	std::deque<CoWaiter> waiters_;
+};
+
+/** A counting semaphore for coroutines.
+    A coroutine that can't acquire it is suspended (not its thread),
+	and is handed the count directly by the release() that wakes it.
+	release() throws std::logic_error if it would push the count above maxCount,
+	which catches releasing something that was never acquired. */
+class CoSemaphore {
+public:
+	explicit CoSemaphore(int count = 0, int maxCount = INT_MAX)
+		: count_(count), maxCount_(maxCount)
+	{
+	}
+
+	struct Awaiter {
+		CoSemaphore& semaphore;
+
+		bool await_ready() { return semaphore.try_acquire(); }
+
+		template <typename Promise>
+		bool await_suspend(std::coroutine_handle<Promise> handle)
+		{
+			std::lock_guard<std::mutex> guard(semaphore.mutex_);
+			if (semaphore.count_ > 0) {
+				--semaphore.count_; // Released while we were getting here: don't suspend
+				return false;
+			}
+			semaphore.waiters_.push_back(CoWaiter{ handle.promise().farm_, handle });
+			return true;
+		}
+
+		void await_resume() {}
+	};
+
+	/** co_await semaphore.acquire() suspends until the count can be decremented. */
+	Awaiter acquire() { return Awaiter{ *this }; }
+
+	bool try_acquire()
+	{
+		std::lock_guard<std::mutex> guard(mutex_);
+		if (count_ == 0) return false;
+		--count_;
+		return true;
+	}
+
+	void release()
+	{
+		CoWaiter waiter;
+		{
+			std::lock_guard<std::mutex> guard(mutex_);
+			if (waiters_.empty()) {
+				if (count_ >= maxCount_) {
+					throw std::logic_error("CoSemaphore released more times than it was acquired");
+				}
+				++count_;
+				return;
+			}
+			waiter = waiters_.front();
+			waiters_.pop_front();
+		}
+		co_schedule(waiter.farm, waiter.handle);
+	}
+
+private:
+	std::mutex mutex_;
+	int count_;
+	const int maxCount_;
+	std::deque<CoWaiter> waiters_;
+};
+
+#endif
@@ -7,11 +7,33 @@
 #include "farm.h"
 #include "task.h"
 #include "messagetask.h"
+#include "cofarm.h"
+#include "cotask.h"
 
 // Import things we need from the standard library
 using std::cout;
 using std::to_string;
 
+// A coroutine task: it waits without holding on to a worker thread
+CoTask<int> slow_square(int x)
+{
+	co_await sleep_for(std::chrono::milliseconds(100));
+	co_return x * x;
+}
+
+CoTask<> message_after_square(int i, CoEvent& go)
+{
+	co_await go.wait();
+	int result = co_await slow_square(i);
+	cout << "I am coroutine " + to_string(i) + ", my square is " + to_string(result) + "\n";
+}
+
+CoTask<> start_after_delay(CoEvent& go)
+{
+	co_await sleep_for(std::chrono::milliseconds(500));
+	go.set();
+}
+
 int main(int argc, char *argv[])
 {
 	// Example: create and run a single task
@@ -30,5 +52,18 @@ int main(int argc, char *argv[])
 	f.run();
 	cout << "Tasks complete!\n";
 
+	// Example: run a load of coroutine tasks on a few threads.
+	// They all sleep at the same time, but no thread is blocked while they do.
+	CoFarm cf(2);
+	CoEvent go;
+	for (int i = 0; i < 1000; ++i)
+	{
+		cf.spawn(message_after_square(i, go));
+	}
+	cf.spawn(start_after_delay(go));
+	cout << "Running coroutine farm...\n";
+	cf.run();
+	cout << "Coroutines complete!\n";
+
 	return 0;
-}
\ No newline at end of file
+}
\ No newline at end of file